@@ -1,14 +1,31 @@
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <mutex>
 #include <numeric>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 #include "camera.h"
+#include "environment.h"
 #include "hitable.h"
 #include "hitable_list.h"
+#include "light_list.h"
 #include "material.h"
 #include "misc.h"
+#include "preview.h"
 #include "ray.h"
 #include "sphere.h"
 #include "vec3.h"
@@ -16,35 +33,267 @@
 constexpr size_t samples_per_pixel = 50;
 constexpr size_t bounces = 10;
 
+// Balances light sampling against BSDF sampling for the same direction.
+double power_heuristic(double pdf, double other_pdf) {
+  const auto a = pdf * pdf;
+  const auto b = other_pdf * other_pdf;
+  return a + b > 0.0 ? a / (a + b) : 0.0;
+}
+
+// bsdf_pdf is the solid angle pdf with which the previous bounce picked r. It
+// is empty for camera rays and specular bounces, whose light hits next-event
+// estimation never accounts for.
 color3d ray_color(const ray<double> &r, const hitable<double> &world,
-                  size_t depth) {
+                  const light_list<double> &lights, size_t depth,
+                  std::optional<double> bsdf_pdf = std::nullopt) {
   if (depth == 0)
     return color3d(0.0, 0.0, 0.0);
 
   auto rec = world.hit(r, 0.001, std::numeric_limits<double>::infinity());
   if (rec) {
-    /*
-    point3d target = rec.value().p + rec.value().normal +
-                     unit_vector(point3d::random_in_unit_sphere());
-    return 0.5 *
-           ray_color(ray<double>(rec.value().p, interpret_as<type::direction>(
-                                                    target - rec.value().p)),
-                     world, depth - 1);
-                     */
-    auto scatter = rec.value().mat->scatter(r, rec.value());
-    if (scatter)
-      return std::get<0>(scatter.value()) *
-             ray_color(std::get<1>(scatter.value()), world, depth - 1);
-    return color3d(0.0, 0.0, 0.0);
+    const auto &mat = rec.value().mat;
+
+    auto emitted = mat->emitted(r, rec.value());
+    if (bsdf_pdf && mat->is_emissive())
+      emitted *= power_heuristic(
+          bsdf_pdf.value(), lights.pdf_value(r.origin(), r.direction()));
+
+    auto scatter = mat->scatter(r, rec.value());
+    if (!scatter)
+      return emitted;
+
+    const auto &[attenuation, scattered] = scatter.value();
+    color3d direct{0.0, 0.0, 0.0};
+    std::optional<double> scattered_pdf;
+
+    if (!mat->is_specular()) {
+      if (auto light = lights.sample(world, rec.value().p)) {
+        const auto &[radiance, wi, light_pdf] = light.value();
+        // The BSDF ray of the last bounce is cut off before it can reach a
+        // light, so next-event estimation has to carry all of it there.
+        const auto weight =
+            depth > 1 ? power_heuristic(light_pdf, mat->pdf(r, rec.value(), wi))
+                      : 1.0;
+        direct = weight / light_pdf * mat->eval(r, rec.value(), wi) * radiance;
+      }
+      scattered_pdf = mat->pdf(r, rec.value(), scattered.direction());
+    }
+
+    return emitted + direct +
+           attenuation *
+               ray_color(scattered, world, lights, depth - 1, scattered_pdf);
+  }
+
+  if (const auto &env = lights.env()) {
+    auto radiance = env->eval(r.direction());
+    if (bsdf_pdf)
+      radiance *= power_heuristic(bsdf_pdf.value(),
+                                  lights.environment_pdf(r.direction()));
+    return radiance;
   }
+
   dir3d unit_direction = unit_vector(r.direction());
   auto t = 0.5 * (unit_direction.y() + 1.0);
   return (1.0 - t) * color3d(1.0, 1.0, 1.0) + t * color3d(0.5, 0.7, 1.0);
 }
 
-int main() {
+struct camera_settings {
+  point3d look_from{13.0, 2.0, 3.0};
+  point3d look_at{0.0, 0.0, 0.0};
+  dir3d up{0.0, 1.0, 0.0};
+  double vfov = 20.0;
+  double aperture = 0.1;
+  double focus_distance = 10.0;
+
+  // Rejects settings that would give the camera a degenerate basis.
+  bool valid() const {
+    const auto forward = interpret_as<type::direction>(look_from - look_at);
+    return vfov > 0.0 && vfov < 180.0 && aperture >= 0.0 &&
+           focus_distance > 0.0 && cross(up, forward).length_squared() > 0.0;
+  }
+
+  camera<double> make(double aspect_ratio) const {
+    return camera<double>(look_from, look_at, up, vfov, aspect_ratio, aperture,
+                          focus_distance);
+  }
+};
+
+// Lines read from stdin by a background thread, handed to the render loop
+// between passes so edits never race with tracing. The loop polls pending()
+// while tracing to cut a pass short.
+class command_queue {
+public:
+  void push(std::string line) {
+    std::lock_guard lock{mutex_};
+    lines_.push_back(std::move(line));
+    cv_.notify_one();
+  }
+
+  void close() {
+    std::lock_guard lock{mutex_};
+    closed_ = true;
+    cv_.notify_one();
+  }
+
+  // Takes all pending lines, waiting for one first if asked to. Returns
+  // nothing once stdin is closed and drained.
+  std::optional<std::deque<std::string>> take(bool wait) {
+    std::unique_lock lock{mutex_};
+    if (wait)
+      cv_.wait(lock, [this] { return !lines_.empty() || closed_; });
+    if (lines_.empty() && closed_ && wait)
+      return {};
+    return std::exchange(lines_, {});
+  }
+
+  bool pending() {
+    std::lock_guard lock{mutex_};
+    return !lines_.empty();
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::string> lines_;
+  bool closed_ = false;
+};
+
+enum class edit { none, camera, material };
+
+// Applies one preview command:
+//   look_from x y z | look_at x y z | vfov deg | aperture a | focus d
+//   albedo <object> r g b
+edit apply_command(const std::string &line, camera_settings &view,
+                   const hitable_list<double> &world) {
+  std::istringstream in(line);
+  std::string name;
+  in >> name;
+
+  // True once the arguments were read and nothing but whitespace is left.
+  auto consumed = [&] { return in && (in >> std::ws).eof(); };
+
+  auto next = view;
+  double x, y, z;
+  size_t object;
+  if (name == "look_from" && in >> x >> y >> z && consumed())
+    next.look_from = point3d(x, y, z);
+  else if (name == "look_at" && in >> x >> y >> z && consumed())
+    next.look_at = point3d(x, y, z);
+  else if (name == "vfov" && in >> x && consumed())
+    next.vfov = x;
+  else if (name == "aperture" && in >> x && consumed())
+    next.aperture = x;
+  else if (name == "focus" && in >> x && consumed())
+    next.focus_distance = x;
+  else if (name == "albedo" && in >> object >> x >> y >> z && consumed() &&
+           object < world.objects_.size()) {
+    auto s = std::dynamic_pointer_cast<sphere<double>>(world.objects_[object]);
+    auto mat = s ? s->mat().get() : nullptr;
+    if (auto diffuse = dynamic_cast<lambertian<double> *>(mat)) {
+      diffuse->set_albedo(color3d(x, y, z));
+      return edit::material;
+    } else if (auto shiny = dynamic_cast<metal<double> *>(mat)) {
+      shiny->set_albedo(color3d(x, y, z));
+      return edit::material;
+    }
+    std::cerr << "Preview: object " << object << " has no " << name << "\n";
+    return edit::none;
+  } else {
+    std::cerr << "Preview: cannot parse '" << line << "'\n";
+    return edit::none;
+  }
+
+  if (!next.valid()) {
+    std::cerr << "Preview: cannot parse '" << line << "'\n";
+    return edit::none;
+  }
+  view = next;
+  return edit::camera;
+}
+
+// Streams progressively refined binary PPM frames to stdout, e.g. into
+// `ffplay -f image2pipe -i -`, while reading edits from stdin. Stops once
+// stdin is closed and the image has reached samples_per_pixel. start is
+// when the process started, so the first frame time includes scene setup.
+int run_preview(const hitable_list<double> &world,
+                const light_list<double> &lights, camera_settings view,
+                size_t width, size_t height, double aspect_ratio,
+                std::chrono::system_clock::time_point start) {
+#ifdef _WIN32
+  _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+  auto tracer = [&](const ray<double> &r) {
+    return ray_color(r, world, lights, bounces);
+  };
+  preview<double, decltype(tracer)> session(width, height,
+                                            view.make(aspect_ratio), tracer);
+
+  auto commands = std::make_shared<command_queue>();
+  std::thread([commands] {
+    for (std::string line; std::getline(std::cin, line);)
+      if (line.find_first_not_of(" \t\r") != std::string::npos)
+        commands->push(line);
+    commands->close();
+  }).detach();
+
+  bool first_frame = true;
+  while (true) {
+    const bool converged = session.samples() >= samples_per_pixel;
+    auto lines = commands->take(converged);
+    if (!lines)
+      return 0;
+
+    bool camera_changed = false;
+    bool material_changed = false;
+    for (const auto &line : lines.value()) {
+      const auto changed = apply_command(line, view, world);
+      camera_changed |= changed == edit::camera;
+      material_changed |= changed == edit::material;
+    }
+
+    if (camera_changed)
+      session.set_camera(view.make(aspect_ratio));
+    else if (material_changed)
+      session.restart();
+    else if (converged)
+      continue;
+
+    // A line arriving mid-pass abandons it. The next iteration applies the
+    // edit and starts over with a coarse frame, or simply redoes the pass if
+    // the line changed nothing.
+    if (!session.refine([&] { return commands->pending(); }))
+      continue;
+    session.write_frame(std::cout);
+
+    if (first_frame) {
+      std::cerr << "First frame: "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::system_clock::now() - start)
+                << "\n";
+      first_frame = false;
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  bool preview_mode = false;
+  const char *env_path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--preview") {
+      preview_mode = true;
+    } else if (arg.starts_with("--") || env_path) {
+      std::cerr << "Usage: rt [--preview] [environment.pfm|.hdr]\n";
+      return 1;
+    } else {
+      env_path = argv[i];
+    }
+  }
+
   std::cerr << "Time start!\n";
   auto timer = std::chrono::system_clock::now();
+  const auto start = timer;
 
   // Image
   constexpr auto aspect_ratio = 16.0 / 9.0;
@@ -53,15 +302,8 @@ int main() {
   std::array<color3d, image_height * image_width> screen;
 
   // Camera
-  point3d look_from{13.0, 2.0, 3.0};
-  point3d look_at{0.0, 0.0, 0.0};
-  dir3d up{0.0, 1.0, 0.0};
-
-  const auto dist_to_focus = 10.0f;
-  const auto aperture = 0.1;
-
-  camera<double> cam(look_from, look_at, up, 20, aspect_ratio, aperture,
-                     dist_to_focus);
+  camera_settings view;
+  camera<double> cam = view.make(aspect_ratio);
 
   // World
   auto material_ground =
@@ -101,6 +343,24 @@ int main() {
             center, 0.2, std::make_shared<dielectric<double>>(1.5)));
       }
     }
+
+  // Optional HDR environment map (.pfm or .hdr) replacing the sky gradient.
+  std::shared_ptr<const environment<double>> env;
+  if (env_path) {
+    try {
+      env = std::make_shared<const environment<double>>(env_path);
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << "\n";
+      return 1;
+    }
+  }
+
+  light_list<double> lights{world, env};
+
+  if (preview_mode)
+    return run_preview(world, lights, view, image_width, image_height,
+                       aspect_ratio, start);
+
   // Render
   auto color = [&, x = 0, y = image_height]() mutable {
     color3d pixel_color{0.0, 0.0, 0.0};
@@ -109,7 +369,7 @@ int main() {
       const auto u = (double(x) + random_double()) / (image_width - 1);
       const auto v = (double(y) + random_double()) / (image_height - 1);
       ray<double> r = cam.get_ray(u, v);
-      pixel_color += ray_color(r, world, bounces);
+      pixel_color += ray_color(r, world, lights, bounces);
     }
 
     x++;
@@ -0,0 +1,305 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "misc.h"
+#include "vec3.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <numbers>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// HDR lat-long environment map with importance sampling towards bright
+// regions. Loads PFM (.pfm) and Radiance RGBE (.hdr) images.
+//
+// Texels are stored as packed RGB floats, row-major with row 0 at the zenith,
+// so directions close to each other read neighbouring memory.
+template <typename T> class environment {
+public:
+  environment(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      throw std::runtime_error("environment: cannot open " + path);
+
+    char magic[2] = {};
+    file.read(magic, 2);
+    file.seekg(0);
+    if (magic[0] == 'P' && (magic[1] == 'F' || magic[1] == 'f'))
+      load_pfm(file);
+    else if (magic[0] == '#' && magic[1] == '?')
+      load_rgbe(file);
+    else
+      throw std::runtime_error("environment: unknown format " + path);
+
+    build_distribution();
+  }
+
+  size_t width() const noexcept { return width_; }
+  size_t height() const noexcept { return height_; }
+
+  // Radiance arriving from direction d.
+  color<T> eval(const dir<T> &d) const noexcept {
+    const auto [x, y] = texel(unit_vector(d));
+    const float *p = &texels_[3 * (y * width_ + x)];
+    return color<T>{p[0], p[1], p[2]};
+  }
+
+  // Picks a direction proportionally to luminance times solid angle.
+  // Returns the direction and its solid angle pdf, or nothing for a black
+  // map.
+  std::optional<std::tuple<dir<T>, T>> sample() const noexcept {
+    if (total_ <= 0)
+      return {};
+
+    const size_t y = pick(marginal_cdf_.data(), height_, random_double());
+    const size_t x = pick(&conditional_cdf_[y * (width_ + 1)], width_,
+                          random_double());
+
+    const T s = (x + random_double()) / width_;
+    const T t = (y + random_double()) / height_;
+    const T phi = (s - T(0.5)) * 2 * std::numbers::pi_v<T>;
+    const T theta = t * std::numbers::pi_v<T>;
+
+    dir<T> d{sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi)};
+    return std::make_tuple(d, pdf(d));
+  }
+
+  // Solid angle pdf of sample() returning d.
+  T pdf(const dir<T> &d) const noexcept {
+    if (total_ <= 0)
+      return 0;
+
+    const auto u = unit_vector(d);
+    const auto [x, y] = texel(u);
+    const T sin_theta = sqrt(std::max<T>(0, 1 - u.y() * u.y()));
+    if (sin_theta <= 0)
+      return 0;
+
+    const T texel_probability = weight(x, y) / total_;
+    return texel_probability * width_ * height_ /
+           (2 * std::numbers::pi_v<T> * std::numbers::pi_v<T> * sin_theta);
+  }
+
+private:
+  // Maps a unit direction to its texel; clamps instead of branching.
+  std::tuple<size_t, size_t> texel(const dir<T> &u) const noexcept {
+    const T phi = atan2(u.z(), u.x());
+    const T theta = acos(std::clamp<T>(u.y(), -1, 1));
+    const T s = phi * std::numbers::inv_pi_v<T> * T(0.5) + T(0.5);
+    const T t = theta * std::numbers::inv_pi_v<T>;
+
+    const auto x = std::min(static_cast<size_t>(s * width_), width_ - 1);
+    const auto y = std::min(static_cast<size_t>(t * height_), height_ - 1);
+    return {x, y};
+  }
+
+  // Texel luminance scaled by the solid angle its row covers.
+  T weight(size_t x, size_t y) const noexcept {
+    const float *p = &texels_[3 * (y * width_ + x)];
+    const T luminance = T(0.2126) * p[0] + T(0.7152) * p[1] + T(0.0722) * p[2];
+    return luminance * row_sin_[y];
+  }
+
+  // Index of the bucket of a normalized cdf with n + 1 entries holding u.
+  static size_t pick(const T *cdf, size_t n, T u) noexcept {
+    const auto it = std::upper_bound(cdf + 1, cdf + n + 1, u);
+    return std::min(static_cast<size_t>(it - (cdf + 1)), n - 1);
+  }
+
+  void build_distribution() {
+    row_sin_.resize(height_);
+    conditional_cdf_.resize(height_ * (width_ + 1));
+    std::vector<T> row_sum(height_);
+
+    auto build_rows = [&](size_t begin, size_t end) {
+      for (size_t y = begin; y < end; y++) {
+        row_sin_[y] = sin((y + T(0.5)) / height_ * std::numbers::pi_v<T>);
+
+        T *cdf = &conditional_cdf_[y * (width_ + 1)];
+        cdf[0] = 0;
+        for (size_t x = 0; x < width_; x++)
+          cdf[x + 1] = cdf[x] + weight(x, y);
+
+        row_sum[y] = cdf[width_];
+        for (size_t x = 1; x <= width_; x++)
+          cdf[x] = row_sum[y] > 0 ? cdf[x] / row_sum[y] : T(x) / width_;
+      }
+    };
+
+    // Rows are independent, so each thread takes a contiguous band.
+    const size_t threads = std::clamp<size_t>(
+        std::thread::hardware_concurrency(), 1, height_);
+    const size_t band = (height_ + threads - 1) / threads;
+    {
+      std::vector<std::jthread> workers;
+      for (size_t begin = 0; begin < height_; begin += band)
+        workers.emplace_back(build_rows, begin,
+                             std::min(begin + band, height_));
+    }
+
+    marginal_cdf_.resize(height_ + 1);
+    marginal_cdf_[0] = 0;
+    for (size_t y = 0; y < height_; y++)
+      marginal_cdf_[y + 1] = marginal_cdf_[y] + row_sum[y];
+
+    total_ = marginal_cdf_[height_];
+    for (size_t y = 1; y <= height_; y++)
+      marginal_cdf_[y] =
+          total_ > 0 ? marginal_cdf_[y] / total_ : T(y) / height_;
+  }
+
+  // Accepts plain decimal digits only, so "-1" cannot wrap around.
+  static size_t parse_dimension(const std::string &token) {
+    if (token.empty() || token.size() > 9 ||
+        !std::all_of(token.begin(), token.end(),
+                     [](char c) { return c >= '0' && c <= '9'; }))
+      throw std::runtime_error("environment: bad dimensions");
+    return std::stoul(token);
+  }
+
+  // Keeps every buffer size derived from width_ and height_ (at most four
+  // values per texel) far from wrapping around.
+  void check_dimensions() const {
+    static constexpr size_t max_dimension = 1 << 16;
+    const size_t limit = std::vector<T>().max_size() / 4;
+    if (width_ == 0 || height_ == 0 || width_ > max_dimension ||
+        height_ > max_dimension || width_ > limit / height_)
+      throw std::runtime_error("environment: bad dimensions");
+  }
+
+  static std::string read_token(std::istream &in) {
+    std::string token;
+    in >> token;
+    if (!in)
+      throw std::runtime_error("environment: truncated header");
+    return token;
+  }
+
+  void load_pfm(std::istream &in) {
+    const auto magic = read_token(in);
+    const size_t channels = magic == "PF" ? 3 : 1;
+    width_ = parse_dimension(read_token(in));
+    height_ = parse_dimension(read_token(in));
+    check_dimensions();
+
+    double scale;
+    try {
+      scale = std::stod(read_token(in));
+    } catch (const std::logic_error &) {
+      throw std::runtime_error("environment: bad PFM header");
+    }
+    in.get(); // single whitespace before the raster
+
+    std::vector<float> raster(channels * width_ * height_);
+    in.read(reinterpret_cast<char *>(raster.data()),
+            raster.size() * sizeof(float));
+    if (!in)
+      throw std::runtime_error("environment: truncated PFM raster");
+
+    const bool little_endian = scale < 0;
+    if (little_endian != (std::endian::native == std::endian::little))
+      for (auto &value : raster) {
+        char bytes[sizeof(float)];
+        std::memcpy(bytes, &value, sizeof(float));
+        std::reverse(bytes, bytes + sizeof(float));
+        std::memcpy(&value, bytes, sizeof(float));
+      }
+
+    // PFM stores the bottom row first.
+    texels_.resize(3 * width_ * height_);
+    for (size_t y = 0; y < height_; y++)
+      for (size_t x = 0; x < width_; x++)
+        for (size_t c = 0; c < 3; c++)
+          texels_[3 * (y * width_ + x) + c] =
+              raster[channels * ((height_ - 1 - y) * width_ + x) +
+                     c % channels];
+  }
+
+  void load_rgbe(std::istream &in) {
+    std::string line;
+    while (std::getline(in, line) && !line.empty())
+      if (line.starts_with("FORMAT=") && line != "FORMAT=32-bit_rle_rgbe")
+        throw std::runtime_error("environment: unsupported " + line);
+
+    std::getline(in, line);
+    std::istringstream resolution(line);
+    std::string y_axis, height, x_axis, width;
+    resolution >> y_axis >> height >> x_axis >> width;
+    if (!resolution || y_axis != "-Y" || x_axis != "+X")
+      throw std::runtime_error("environment: unsupported resolution " + line);
+    width_ = parse_dimension(width);
+    height_ = parse_dimension(height);
+    check_dimensions();
+
+    texels_.resize(3 * width_ * height_);
+    std::vector<uint8_t> scanline(4 * width_);
+
+    for (size_t y = 0; y < height_; y++) {
+      uint8_t head[4];
+      read_bytes(in, head, 4);
+
+      const bool rle = width_ >= 8 && width_ < 0x8000 && head[0] == 2 &&
+                       head[1] == 2 &&
+                       static_cast<size_t>(head[2] << 8 | head[3]) == width_;
+      if (rle) {
+        // Each channel is stored separately as runs and literals.
+        for (size_t c = 0; c < 4; c++)
+          for (size_t x = 0; x < width_;) {
+            uint8_t count;
+            read_bytes(in, &count, 1);
+            const bool run = count > 128;
+            const size_t n = run ? count - 128 : count;
+            if (n == 0 || x + n > width_)
+              throw std::runtime_error("environment: bad RGBE scanline");
+
+            if (run) {
+              uint8_t value;
+              read_bytes(in, &value, 1);
+              for (size_t i = 0; i < n; i++)
+                scanline[4 * (x + i) + c] = value;
+            } else {
+              for (size_t i = 0; i < n; i++)
+                read_bytes(in, &scanline[4 * (x + i) + c], 1);
+            }
+            x += n;
+          }
+      } else {
+        std::copy(head, head + 4, scanline.begin());
+        read_bytes(in, &scanline[4], 4 * (width_ - 1));
+      }
+
+      for (size_t x = 0; x < width_; x++) {
+        const uint8_t *rgbe = &scanline[4 * x];
+        const float f = rgbe[3] ? std::ldexp(1.0f, rgbe[3] - (128 + 8)) : 0.0f;
+        for (size_t c = 0; c < 3; c++)
+          texels_[3 * (y * width_ + x) + c] = rgbe[c] * f;
+      }
+    }
+  }
+
+  static void read_bytes(std::istream &in, uint8_t *dst, size_t n) {
+    in.read(reinterpret_cast<char *>(dst), n);
+    if (!in)
+      throw std::runtime_error("environment: truncated RGBE raster");
+  }
+
+  size_t width_ = 0;
+  size_t height_ = 0;
+  std::vector<float> texels_;
+
+  std::vector<T> row_sin_;
+  std::vector<T> conditional_cdf_;
+  std::vector<T> marginal_cdf_;
+  T total_ = 0;
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "ray.h"
 #include "vec3.h"
+#include <memory>
 #include <optional>
 
 template <typename T> struct material;
@@ -19,6 +20,12 @@ template <typename T> struct hitable {
   virtual std::optional<hit_data<T>> hit(const ray<T> &r, T t_min,
                                          T t_max) const noexcept = 0;
 
+  // Any-hit query for shadow rays: true as soon as anything lies in
+  // (t_min, t_max). Override when it can be answered cheaper than hit().
+  virtual bool occluded(const ray<T> &r, T t_min, T t_max) const noexcept {
+    return hit(r, t_min, t_max).has_value();
+  }
+
   virtual ~hitable() = default;
 };
 
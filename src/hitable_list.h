@@ -3,6 +3,7 @@
 
 #include "hitable.h"
 #include "material.h"
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -33,6 +34,13 @@ public:
     return hit_anything ? std::optional<hit_data<T>>{best_rec} : std::nullopt;
   }
 
+  bool occluded(const ray<T> &r, T t_min, T t_max) const noexcept override {
+    return std::any_of(objects_.begin(), objects_.end(),
+                       [&](const auto &object) {
+                         return object->occluded(r, t_min, t_max);
+                       });
+  }
+
 public:
   std::vector<std::shared_ptr<hitable<T>>> objects_;
 };
@@ -0,0 +1,110 @@
+#ifndef LIGHT_LIST_H
+#define LIGHT_LIST_H
+
+#include "environment.h"
+#include "hitable.h"
+#include "hitable_list.h"
+#include "material.h"
+#include "misc.h"
+#include "ray.h"
+#include "sphere.h"
+#include "vec3.h"
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+// Emissive spheres of a scene plus an optional environment map, used for
+// next-event estimation.
+template <typename T> class light_list {
+public:
+  light_list(const hitable_list<T> &world,
+             std::shared_ptr<const environment<T>> env = nullptr)
+      : environment_{env} {
+    for (const auto &object : world.objects_)
+      if (auto s = std::dynamic_pointer_cast<sphere<T>>(object))
+        if (s->mat() && s->mat()->is_emissive())
+          lights_.push_back(s);
+  }
+
+  bool empty() const noexcept { return count() == 0; }
+
+  const std::shared_ptr<const environment<T>> &env() const noexcept {
+    return environment_;
+  }
+
+  // Solid angle pdf of sample() producing direction v from o towards one of
+  // the spheres. Each light is picked uniformly, so this is the mean of the
+  // per light cone pdfs.
+  T pdf_value(const point<T> &o, const dir<T> &v) const noexcept {
+    if (lights_.empty())
+      return 0;
+
+    T sum = 0;
+    for (const auto &light : lights_)
+      sum += light->pdf_value(o, v);
+    return sum / count();
+  }
+
+  // Solid angle pdf of sample() producing an escaping direction v.
+  T environment_pdf(const dir<T> &v) const noexcept {
+    return environment_ ? environment_->pdf(v) / count() : 0;
+  }
+
+  // Picks a light, samples a direction towards it and traces a shadow ray.
+  // Returns the incoming radiance, its direction and the pdf of sampling it,
+  // or nothing if the light is occluded or unreachable from p.
+  std::optional<std::tuple<color<T>, dir<T>, T>>
+  sample(const hitable<T> &world, const point<T> &p) const noexcept {
+    if (empty())
+      return {};
+
+    const auto index = std::min(static_cast<size_t>(random_double() * count()),
+                                count() - 1);
+    if (index == lights_.size())
+      return sample_environment(world, p);
+
+    const auto &light = lights_[index];
+
+    auto wi = light->sample_direction(p);
+    const auto pdf = pdf_value(p, wi);
+    if (pdf <= 0)
+      return {};
+
+    ray<T> shadow(p, wi);
+    auto rec = light->hit(shadow, 0.001, std::numeric_limits<T>::infinity());
+    if (!rec || world.occluded(shadow, 0.001, rec.value().t - 0.001))
+      return {};
+
+    auto radiance = rec.value().mat->emitted(shadow, rec.value());
+    return std::make_tuple(radiance, wi, pdf);
+  }
+
+private:
+  size_t count() const noexcept {
+    return lights_.size() + (environment_ ? 1 : 0);
+  }
+
+  std::optional<std::tuple<color<T>, dir<T>, T>>
+  sample_environment(const hitable<T> &world,
+                     const point<T> &p) const noexcept {
+    auto sampled = environment_->sample();
+    if (!sampled)
+      return {};
+
+    const auto &[wi, pdf] = sampled.value();
+    if (pdf <= 0 ||
+        world.occluded(ray<T>(p, wi), 0.001,
+                       std::numeric_limits<T>::infinity()))
+      return {};
+
+    return std::make_tuple(environment_->eval(wi), wi, pdf / count());
+  }
+
+  std::vector<std::shared_ptr<sphere<T>>> lights_;
+  std::shared_ptr<const environment<T>> environment_;
+};
+
+#endif
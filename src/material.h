@@ -1,6 +1,8 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include <algorithm>
+#include <numbers>
 #include <optional>
 #include <tuple>
 
@@ -13,6 +15,30 @@ public:
   virtual std::optional<std::tuple<color<T>, ray<T>>>
   scatter(const ray<T> &r, const hit_data<T> &hit_data) const noexcept = 0;
 
+  // Radiance leaving the surface by itself; black for everything but lights.
+  virtual color<T> emitted(const ray<T> &r,
+                           const hit_data<T> &hit_data) const noexcept {
+    return color<T>{0, 0, 0};
+  }
+
+  virtual bool is_emissive() const noexcept { return false; }
+
+  // Delta-like lobes never agree with a sampled light direction, so the
+  // integrator skips next-event estimation for them.
+  virtual bool is_specular() const noexcept { return true; }
+
+  // BSDF times cosine towards wi, and the solid angle pdf with which
+  // scatter() would have picked wi. Only meaningful for non-specular ones.
+  virtual color<T> eval(const ray<T> &r, const hit_data<T> &hit_data,
+                        const dir<T> &wi) const noexcept {
+    return color<T>{0, 0, 0};
+  }
+
+  virtual T pdf(const ray<T> &r, const hit_data<T> &hit_data,
+                const dir<T> &wi) const noexcept {
+    return 0;
+  }
+
   virtual ~material() = default;
 };
 
@@ -31,6 +57,22 @@ public:
     return std::make_tuple(albedo_, ray<T>(hit_data.p, scatter_dir));
   }
 
+  void set_albedo(const color<T> &albedo) noexcept { albedo_ = albedo; }
+
+  bool is_specular() const noexcept override { return false; }
+
+  color<T> eval(const ray<T> &r, const hit_data<T> &hit_data,
+                const dir<T> &wi) const noexcept override {
+    return pdf(r, hit_data, wi) * albedo_;
+  }
+
+  // scatter() is cosine weighted: normal + a point on the unit sphere.
+  T pdf(const ray<T> &r, const hit_data<T> &hit_data,
+        const dir<T> &wi) const noexcept override {
+    const T cos_theta = dot(hit_data.normal, unit_vector(wi));
+    return std::max<T>(cos_theta, 0) * std::numbers::inv_pi_v<T>;
+  }
+
 private:
   color<T> albedo_;
 };
@@ -39,6 +81,8 @@ template <typename T> struct metal : public material<T> {
 public:
   metal(const color<T> &albedo, T fuzz = 0) : albedo_{albedo}, fuzz_{fuzz} {}
 
+  void set_albedo(const color<T> &albedo) noexcept { albedo_ = albedo; }
+
   std::optional<std::tuple<color<T>, ray<T>>>
   scatter(const ray<T> &r,
           const hit_data<T> &hit_data) const noexcept override {
@@ -87,4 +131,25 @@ private:
   T ir_;
 };
 
+template <typename T> struct diffuse_light : public material<T> {
+public:
+  diffuse_light(const color<T> &emit) : emit_{emit} {}
+
+  std::optional<std::tuple<color<T>, ray<T>>>
+  scatter(const ray<T> &r,
+          const hit_data<T> &hit_data) const noexcept override {
+    return {};
+  }
+
+  color<T> emitted(const ray<T> &r,
+                   const hit_data<T> &hit_data) const noexcept override {
+    return hit_data.front_face ? emit_ : color<T>{0, 0, 0};
+  }
+
+  bool is_emissive() const noexcept override { return true; }
+
+private:
+  color<T> emit_;
+};
+
 #endif
\ No newline at end of file
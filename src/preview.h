@@ -0,0 +1,109 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "camera.h"
+#include "misc.h"
+#include "ray.h"
+#include "vec3.h"
+#include <algorithm>
+#include <ostream>
+#include <vector>
+
+// Progressive renderer for look development. The first passes trace one ray
+// per block of coarsest_scale^2 pixels and halve the block size each pass;
+// once at full resolution every pass adds one sample per pixel. Changing the
+// camera or anything the tracer reads only needs restart(), the scene and
+// its lights are left alone.
+template <typename T, typename Tracer> class preview {
+public:
+  static constexpr size_t coarsest_scale = 16;
+
+  preview(size_t width, size_t height, const camera<T> &cam, Tracer tracer)
+      : width_{width}, height_{height}, cam_{cam}, tracer_{tracer},
+        accum_(width * height), pass_(width * height) {}
+
+  void set_camera(const camera<T> &cam) {
+    cam_ = cam;
+    restart();
+  }
+
+  void restart() noexcept {
+    scale_ = coarsest_scale;
+    samples_ = 0;
+  }
+
+  // Samples per pixel accumulated at full resolution so far.
+  size_t samples() const noexcept { return samples_; }
+
+  // Renders one pass, polling stop() after every row of blocks and
+  // abandoning the pass once it returns true, so an edit need not wait for a
+  // slow full resolution pass. Accumulating passes trace into a separate
+  // buffer, so an abandoned one leaves the samples so far untouched. Returns
+  // whether the pass completed.
+  template <typename Stop> bool refine(Stop stop) {
+    // Coarse passes and the first full resolution one replace the image.
+    const bool overwrite = samples_ == 0;
+    auto &target = overwrite ? accum_ : pass_;
+
+    for (size_t by = 0; by < height_; by += scale_) {
+      if (stop())
+        return false;
+
+      // Blocks on the last row and column are clipped to the image.
+      const size_t block_height = std::min(scale_, height_ - by);
+      for (size_t bx = 0; bx < width_; bx += scale_) {
+        const size_t block_width = std::min(scale_, width_ - bx);
+        const auto u = (bx + random_double() * block_width) / (width_ - 1);
+        const auto v =
+            (height_ - by - random_double() * block_height) / (height_ - 1);
+        const auto c = tracer_(cam_.get_ray(u, v));
+
+        for (size_t y = by; y < by + block_height; y++)
+          for (size_t x = bx; x < bx + block_width; x++)
+            target[y * width_ + x] = c;
+      }
+    }
+
+    if (!overwrite)
+      for (size_t i = 0; i < accum_.size(); i++)
+        accum_[i] += pass_[i];
+
+    if (scale_ > 1)
+      scale_ /= 2;
+    else
+      samples_++;
+    return true;
+  }
+
+  // Writes the current image as a binary PPM frame, always at full size so
+  // a viewer reading a stream of frames sees a fixed resolution.
+  void write_frame(std::ostream &out) const {
+    out << "P6\n" << width_ << ' ' << height_ << "\n255\n";
+
+    const T scale = T(1) / std::max<size_t>(samples_, 1);
+    std::vector<unsigned char> row(3 * width_);
+    for (size_t y = 0; y < height_; y++) {
+      for (size_t x = 0; x < width_; x++) {
+        const auto &pix = accum_[y * width_ + x];
+        for (size_t c = 0; c < 3; c++)
+          row[3 * x + c] = static_cast<unsigned char>(
+              256 * clampd<0.0, 0.999>(sqrt(pix[c] * scale)));
+      }
+      out.write(reinterpret_cast<const char *>(row.data()), row.size());
+    }
+    out.flush();
+  }
+
+private:
+  size_t width_;
+  size_t height_;
+  camera<T> cam_;
+  Tracer tracer_;
+
+  std::vector<color<T>> accum_;
+  std::vector<color<T>> pass_;
+  size_t scale_ = coarsest_scale;
+  size_t samples_ = 0;
+};
+
+#endif
@@ -3,8 +3,12 @@
 
 #include "hitable.h"
 #include "material.h"
+#include "misc.h"
 #include "vec3.h"
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <numbers>
 
 template <typename T> class sphere : public hitable<T> {
 public:
@@ -13,6 +17,62 @@ public:
 
   constexpr std::optional<hit_data<T>> hit(const ray<T> &r, T t_min,
                                            T t_max) const noexcept override {
+    auto root = nearest_root(r, t_min, t_max);
+    if (!root)
+      return {};
+
+    hit_data<T> ret;
+    ret.p = r.at(root.value());
+    ret.t = root.value();
+    auto outward_normal =
+        interpret_as<type::direction>((ret.p - center_) / radius_);
+
+    ret.front_face = dot(r.direction(), outward_normal) < 0;
+    ret.normal = ret.front_face ? outward_normal : -outward_normal;
+    ret.mat = mat_;
+    return ret;
+  }
+
+  constexpr bool occluded(const ray<T> &r, T t_min,
+                          T t_max) const noexcept override {
+    return nearest_root(r, t_min, t_max).has_value();
+  }
+
+  const std::shared_ptr<material<T>> &mat() const noexcept { return mat_; }
+
+  // Uniformly samples the cone of directions under which the sphere is seen
+  // from o. Only valid for o outside the sphere.
+  dir<T> sample_direction(const point<T> &o) const noexcept {
+    auto direction = interpret_as<type::direction>(center_ - o);
+    const T cos_theta_max = cone_cos_theta_max(o);
+
+    const T z = 1 + random_double() * (cos_theta_max - 1);
+    const T phi = 2 * std::numbers::pi_v<T> * random_double();
+    const T sin_theta = sqrt(std::max<T>(0, 1 - z * z));
+
+    auto w = unit_vector(direction);
+    auto a = fabs(w.x()) > 0.9 ? dir<T>{0, 1, 0} : dir<T>{1, 0, 0};
+    auto v = unit_vector(cross(w, a));
+    auto u = cross(w, v);
+
+    return cos(phi) * sin_theta * u + sin(phi) * sin_theta * v + z * w;
+  }
+
+  // Solid angle pdf of sample_direction() picking v, zero if v misses.
+  T pdf_value(const point<T> &o, const dir<T> &v) const noexcept {
+    auto oc = interpret_as<type::direction>(center_ - o);
+    if (oc.length_squared() <= radius_ * radius_ ||
+        !occluded(ray<T>(o, v), 0.001, std::numeric_limits<T>::infinity()))
+      return 0;
+
+    const T solid_angle =
+        2 * std::numbers::pi_v<T> * (1 - cone_cos_theta_max(o));
+    return 1 / solid_angle;
+  }
+
+private:
+  constexpr std::optional<T> nearest_root(const ray<T> &r, T t_min,
+                                          T t_max) const noexcept {
     dir<T> oc = interpret_as<type::direction>(r.origin() - center_);
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -30,20 +90,14 @@ public:
       if (root < t_min || t_max < root)
         return {};
     }
+    return root;
+  }
 
-    hit_data<T> ret;
-    ret.p = r.at(root);
-    ret.t = root;
-    auto outward_normal =
-        interpret_as<type::direction>((ret.p - center_) / radius_);
-
-    ret.front_face = dot(r.direction(), outward_normal) < 0;
-    ret.normal = ret.front_face ? outward_normal : -outward_normal;
-    ret.mat = mat_;
-    return ret;
+  T cone_cos_theta_max(const point<T> &o) const noexcept {
+    const T distance_squared = (center_ - o).length_squared();
+    return sqrt(std::max<T>(0, 1 - radius_ * radius_ / distance_squared));
   }
 
-private:
   point<T> center_;
   T radius_;
   std::shared_ptr<material<T>> mat_;